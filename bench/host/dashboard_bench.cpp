@@ -0,0 +1,126 @@
+// Host benchmark for the font_view text layout cache on a dashboard-style redraw loop.
+//
+// Every frame re-measures a fixed set of labels, the way LVGL does on invalidation. A couple of them change
+// value every few frames, like live readings do. The same loop runs twice: once walking every character pair
+// through lv_font_t::get_glyph_dsc (what lv_txt_get_size does), once through font_view::get_text_size().
+//
+// Usage: dashboard_bench <font.ttf> [frames]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include <font_view.hpp>
+
+#define BENCH_FONT_HEIGHT 24
+#define BENCH_DEFAULT_FRAMES 20000
+#define BENCH_LABEL_WIDTH 160
+#define BENCH_LIVE_UPDATE_FRAMES 10
+
+static const char *static_labels[] = {
+        "Speed",
+        "Engine temperature",
+        "Battery",
+        "Trip A",
+        "Outside air, feels like",
+        "Tyre pressure front left",
+};
+
+static lv_coord_t measure_per_char(const lv_font_t *font, const char *txt)
+{
+    lv_coord_t width = 0;
+    uint32_t idx = 0;
+    uint32_t letter = _lv_txt_encoded_next(txt, &idx);
+    while (letter != 0) {
+        uint32_t letter_next = _lv_txt_encoded_next(txt, &idx);
+        lv_font_glyph_dsc_t dsc = {};
+        if (font->get_glyph_dsc(font, &dsc, letter, letter_next)) {
+            width = (lv_coord_t)(width + dsc.adv_w);
+        }
+
+        letter = letter_next;
+    }
+
+    return width;
+}
+
+static void make_live_labels(uint32_t frame, char *speed, size_t speed_len, char *rpm, size_t rpm_len)
+{
+    uint32_t tick = frame / BENCH_LIVE_UPDATE_FRAMES;
+    snprintf(speed, speed_len, "%lu km/h", (unsigned long)(tick % 180));
+    snprintf(rpm, rpm_len, "%lu rpm", (unsigned long)(800 + (tick * 37) % 6000));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <font.ttf> [frames]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t frames = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : BENCH_DEFAULT_FRAMES;
+
+    font_view view("bench", true);
+    if (view.init(argv[1], BENCH_FONT_HEIGHT) != ESP_OK) {
+        fprintf(stderr, "Failed to load %s\n", argv[1]);
+        return 1;
+    }
+
+    lv_obj_t label = {};
+    view.decorate_font_obj(&label);
+    const lv_font_t *font = label.text_font;
+
+    // Sanity: single-line layouts must agree with the per-character walk, wrapped ones must fit
+    for (auto *txt : static_labels) {
+        lv_point_t size = {};
+        const text_layout *layout = nullptr;
+        if (view.get_text_size(txt, 0, 0, 0, LV_TEXT_FLAG_NONE, &size) != ESP_OK || size.x != measure_per_char(font, txt)
+            || view.get_text_layout(txt, 0, 0, BENCH_LABEL_WIDTH, LV_TEXT_FLAG_NONE, &layout) != ESP_OK || layout->width > BENCH_LABEL_WIDTH) {
+            fprintf(stderr, "Layout mismatch for \"%s\"\n", txt);
+            return 1;
+        }
+    }
+
+    char speed[32] = { 0 };
+    char rpm[32] = { 0 };
+    uint64_t checksum = 0;
+    size_t label_cnt = sizeof(static_labels) / sizeof(static_labels[0]);
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < frames; frame += 1) {
+        make_live_labels(frame, speed, sizeof(speed), rpm, sizeof(rpm));
+        for (size_t idx = 0; idx < label_cnt; idx += 1) {
+            checksum += measure_per_char(font, static_labels[idx]);
+        }
+
+        checksum += measure_per_char(font, speed) + measure_per_char(font, rpm);
+    }
+
+    auto per_char_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    view.clear_layout_cache();
+    start = std::chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < frames; frame += 1) {
+        make_live_labels(frame, speed, sizeof(speed), rpm, sizeof(rpm));
+        lv_point_t size = {};
+        for (size_t idx = 0; idx < label_cnt; idx += 1) {
+            view.get_text_size(static_labels[idx], 0, 0, BENCH_LABEL_WIDTH, LV_TEXT_FLAG_NONE, &size);
+            checksum += size.x;
+        }
+
+        view.get_text_size(speed, 0, 0, BENCH_LABEL_WIDTH, LV_TEXT_FLAG_NONE, &size);
+        checksum += size.x;
+        view.get_text_size(rpm, 0, 0, BENCH_LABEL_WIDTH, LV_TEXT_FLAG_NONE, &size);
+        checksum += size.x;
+    }
+
+    auto cached_ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+
+    double measures = (double)frames * (double)(label_cnt + 2);
+    printf("frames: %lu, labels/frame: %zu, checksum: %llu\n", (unsigned long)frames, label_cnt + 2, (unsigned long long)checksum);
+    printf("per-char callbacks: %8.1f ns/label, %8.2f us/frame\n", per_char_ns / measures, per_char_ns / frames / 1000.0);
+    printf("layout cache:       %8.1f ns/label, %8.2f us/frame\n", cached_ns / measures, cached_ns / frames / 1000.0);
+    printf("layout cache usage: %zu bytes\n", font_mem_governor::instance().get_usage(FONT_MEM_LAYOUT));
+
+    return 0;
+}
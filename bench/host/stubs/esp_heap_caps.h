@@ -0,0 +1,12 @@
+// Host stand-in: every capability maps onto the C heap
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+
+#define MALLOC_CAP_SPIRAM (1 << 10)
+
+inline void *heap_caps_malloc(size_t len, uint32_t) { return malloc(len); }
+inline void *heap_caps_calloc(size_t n, size_t len, uint32_t) { return calloc(n, len); }
+inline void *heap_caps_aligned_calloc(size_t, size_t n, size_t len, uint32_t) { return calloc(n, len); }
+inline void heap_caps_free(void *ptr) { free(ptr); }
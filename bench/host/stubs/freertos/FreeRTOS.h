@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+typedef uint32_t TickType_t;
+
+#define portMAX_DELAY       ((TickType_t)0xffffffffUL)
+#define pdTRUE              1
+#define pdFALSE             0
+#define pdPASS              pdTRUE
+#define pdMS_TO_TICKS(ms)   ((TickType_t)(ms))  // 1 tick == 1 ms on the host
+#define tskIDLE_PRIORITY    0
@@ -0,0 +1,75 @@
+// Host stand-in for FreeRTOS mutexes, keeping the recursive/non-recursive distinction the component relies on
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "FreeRTOS.h"
+
+struct host_semaphore
+{
+    std::mutex lock;
+    std::condition_variable cond;
+    std::thread::id owner;
+    uint32_t depth = 0;
+    bool recursive = false;
+};
+
+typedef host_semaphore *SemaphoreHandle_t;
+
+inline SemaphoreHandle_t host_semaphore_create(bool recursive)
+{
+    auto *sem = new host_semaphore;
+    sem->recursive = recursive;
+    return sem;
+}
+
+inline int host_semaphore_take(SemaphoreHandle_t sem, TickType_t wait_ticks)
+{
+    std::unique_lock<std::mutex> guard(sem->lock);
+    auto self = std::this_thread::get_id();
+    if (sem->depth > 0 && sem->owner == self) {
+        if (!sem->recursive) {
+            return pdFALSE;
+        }
+
+        sem->depth += 1;
+        return pdTRUE;
+    }
+
+    auto is_free = [sem] { return sem->depth == 0; };
+    if (wait_ticks == portMAX_DELAY) {
+        sem->cond.wait(guard, is_free);
+    } else if (!sem->cond.wait_for(guard, std::chrono::milliseconds(wait_ticks), is_free)) {
+        return pdFALSE;
+    }
+
+    sem->owner = self;
+    sem->depth = 1;
+    return pdTRUE;
+}
+
+inline int host_semaphore_give(SemaphoreHandle_t sem)
+{
+    std::lock_guard<std::mutex> guard(sem->lock);
+    if (sem->depth == 0 || sem->owner != std::this_thread::get_id()) {
+        return pdFALSE;
+    }
+
+    sem->depth -= 1;
+    if (sem->depth == 0) {
+        sem->cond.notify_one();
+    }
+
+    return pdTRUE;
+}
+
+#define xSemaphoreCreateMutex()             host_semaphore_create(false)
+#define xSemaphoreCreateRecursiveMutex()    host_semaphore_create(true)
+#define xSemaphoreTake(sem, ticks)          host_semaphore_take(sem, ticks)
+#define xSemaphoreGive(sem)                 host_semaphore_give(sem)
+#define xSemaphoreTakeRecursive(sem, ticks) host_semaphore_take(sem, ticks)
+#define xSemaphoreGiveRecursive(sem)        host_semaphore_give(sem)
+#define vSemaphoreDelete(sem)               delete (sem)
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <chrono>
+#include <thread>
+
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+
+inline int xTaskCreate(void (*fn)(void *), const char *, uint32_t, void *arg, uint32_t, TaskHandle_t *handle)
+{
+    auto *thread = new std::thread(fn, arg);
+    thread->detach();
+    if (handle != nullptr) {
+        *handle = thread;
+    }
+
+    return pdPASS;
+}
+
+inline void vTaskDelay(TickType_t ticks) { std::this_thread::sleep_for(std::chrono::milliseconds(ticks)); }
+inline void vTaskDelete(TaskHandle_t) {}
@@ -0,0 +1,109 @@
+// Host stand-in for the slice of LVGL v8 the component touches
+#pragma once
+
+#include <cstdint>
+
+typedef int16_t lv_coord_t;
+
+typedef struct
+{
+    lv_coord_t x;
+    lv_coord_t y;
+} lv_point_t;
+
+typedef struct
+{
+    uint16_t adv_w;
+    uint16_t box_w;
+    uint16_t box_h;
+    int16_t ofs_x;
+    int16_t ofs_y;
+    uint8_t bpp;
+    bool is_placeholder;
+} lv_font_glyph_dsc_t;
+
+typedef struct _lv_font_t
+{
+    bool (*get_glyph_dsc)(const struct _lv_font_t *, lv_font_glyph_dsc_t *, uint32_t, uint32_t);
+    const uint8_t *(*get_glyph_bitmap)(const struct _lv_font_t *, uint32_t);
+    lv_coord_t line_height;
+    lv_coord_t base_line;
+    uint8_t subpx;
+    void *user_data;
+} lv_font_t;
+
+#define LV_FONT_SUBPX_NONE 0
+#define LV_TXT_BREAK_CHARS " ,.;:-_"
+#define LV_TXT_COLOR_CMD "#"
+#define LV_MAX(a, b) ((a) > (b) ? (a) : (b))
+
+enum {
+    LV_TEXT_FLAG_NONE = 0x00,
+    LV_TEXT_FLAG_RECOLOR = 0x01,
+    LV_TEXT_FLAG_EXPAND = 0x02,
+    LV_TEXT_FLAG_FIT = 0x04,
+};
+typedef uint8_t lv_text_flag_t;
+
+enum {
+    LV_TEXT_CMD_STATE_WAIT,
+    LV_TEXT_CMD_STATE_PAR,
+    LV_TEXT_CMD_STATE_IN,
+};
+typedef uint8_t lv_text_cmd_state_t;
+
+typedef struct
+{
+    const lv_font_t *text_font;
+} lv_style_t;
+
+typedef struct
+{
+    const lv_font_t *text_font;
+} lv_obj_t;
+
+inline void lv_style_set_text_font(lv_style_t *style, const lv_font_t *font) { style->text_font = font; }
+inline void lv_obj_set_style_text_font(lv_obj_t *obj, const lv_font_t *font, uint32_t) { obj->text_font = font; }
+
+// UTF-8 decoder with the same contract as LVGL's _lv_txt_encoded_next
+inline uint32_t lv_host_utf8_next(const char *txt, uint32_t *i)
+{
+    auto c = (uint8_t)txt[*i];
+    uint32_t len = c < 0x80 ? 1 : c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+    uint32_t ret = len == 1 ? c : (c & (0x7F >> len));
+    for (uint32_t k = 1; k < len; k += 1) {
+        ret = (ret << 6) | ((uint8_t)txt[*i + k] & 0x3F);
+    }
+
+    *i += len;
+    return ret;
+}
+
+inline uint32_t (*_lv_txt_encoded_next)(const char *, uint32_t *) = lv_host_utf8_next;
+
+// Same state machine as LVGL's _lv_txt_is_cmd: true for "#rrggbb " openers and closing '#', "##" is a literal '#'
+inline bool _lv_txt_is_cmd(lv_text_cmd_state_t *state, uint32_t c)
+{
+    bool ret = false;
+    if (c == (uint32_t)LV_TXT_COLOR_CMD[0]) {
+        if (*state == LV_TEXT_CMD_STATE_WAIT) {
+            *state = LV_TEXT_CMD_STATE_PAR;
+            ret = true;
+        } else if (*state == LV_TEXT_CMD_STATE_PAR) {
+            *state = LV_TEXT_CMD_STATE_WAIT;
+        } else if (*state == LV_TEXT_CMD_STATE_IN) {
+            *state = LV_TEXT_CMD_STATE_WAIT;
+            ret = true;
+        }
+    }
+
+    if (*state == LV_TEXT_CMD_STATE_PAR) {
+        if (c == ' ') {
+            *state = LV_TEXT_CMD_STATE_IN;
+        }
+
+        ret = true;
+    }
+
+    return ret;
+}
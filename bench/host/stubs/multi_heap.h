@@ -0,0 +1,12 @@
+// Host stand-in: the pool is only used as a handle, allocations go to the C heap
+#pragma once
+
+#include <cstdlib>
+#include <malloc.h>
+
+typedef struct multi_heap_info *multi_heap_handle_t;
+
+inline multi_heap_handle_t multi_heap_register(void *start, size_t) { return (multi_heap_handle_t)start; }
+inline void *multi_heap_malloc(multi_heap_handle_t, size_t len) { return malloc(len); }
+inline void multi_heap_free(multi_heap_handle_t, void *ptr) { free(ptr); }
+inline size_t multi_heap_get_allocated_size(multi_heap_handle_t, void *ptr) { return malloc_usable_size(ptr); }
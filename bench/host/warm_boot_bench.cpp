@@ -0,0 +1,179 @@
+// Host benchmark for the hot-set manifest on a warm boot.
+//
+// A first run renders the first frame's glyphs through a caching font_view and saves the hot set. Every boot
+// after that is a fresh process (fork), since all the caches are singletons:
+//   - per-glyph: no RAM tier, every glyph of the first frame is one fopen/fread through get_bitmap()
+//   - hot set:   RAM tier on, add_renderer() bulk-loads hotset.bin, then the same first-frame fetches
+// The host page cache stays warm, so this only shows the per-file overhead, not flash latency.
+//
+// Usage: warm_boot_bench <font.ttf> [boots]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <font_view.hpp>
+#include <font_cacher.hpp>
+#include <font_disk_cacher.hpp>
+
+#define BENCH_FONT_NAME "bench"
+#define BENCH_FONT_HEIGHT 24
+#define BENCH_DEFAULT_BOOTS 50
+#define BENCH_FIRST_GLYPH 0x20
+#define BENCH_LAST_GLYPH 0x7e
+#define BENCH_RAM_TIER_SIZE (256 * 1024)
+#define BENCH_RAM_TIER_SLOTS 512
+
+struct boot_result
+{
+    double load_us;
+    double fetch_us;
+    uint32_t glyph_cnt;
+};
+
+static double elapsed_us(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+static uint32_t fetch_first_frame(const lv_font_t *font)
+{
+    uint32_t glyph_cnt = 0;
+    for (uint32_t cp = BENCH_FIRST_GLYPH; cp <= BENCH_LAST_GLYPH; cp += 1) {
+        if (font->get_glyph_bitmap(font, cp) != nullptr) {
+            glyph_cnt += 1;
+        }
+    }
+
+    return glyph_cnt;
+}
+
+static int populate(const char *font_path, const char *dir)
+{
+    font_cacher::instance().init(BENCH_RAM_TIER_SIZE, BENCH_RAM_TIER_SLOTS);
+    font_disk_cacher::instance().init(dir, nullptr, nullptr);
+
+    font_view view(BENCH_FONT_NAME, false);
+    if (view.init(font_path, BENCH_FONT_HEIGHT) != ESP_OK) {
+        return 1;
+    }
+
+    lv_obj_t label = {};
+    view.decorate_font_obj(&label);
+    fetch_first_frame(label.text_font); // Renders and writes the per-glyph files
+    fetch_first_frame(label.text_font); // Hits, so the hot set has counts to rank by
+    return font_disk_cacher::instance().save_hot_set() == ESP_OK ? 0 : 1;
+}
+
+static boot_result boot(const char *font_path, const char *dir, bool hot_set)
+{
+    boot_result result = {};
+    if (hot_set) {
+        font_cacher::instance().init(BENCH_RAM_TIER_SIZE, BENCH_RAM_TIER_SLOTS);
+    }
+
+    font_disk_cacher::instance().init(dir, nullptr, nullptr);
+
+    // Registered ahead of font_view::init() so the TTF parse isn't part of the load time
+    auto start = std::chrono::steady_clock::now();
+    font_disk_cacher::instance().add_renderer(BENCH_FONT_NAME, BENCH_FONT_HEIGHT);
+    result.load_us = elapsed_us(start);
+
+    font_view view(BENCH_FONT_NAME, false);
+    if (view.init(font_path, BENCH_FONT_HEIGHT) != ESP_OK) {
+        return result;
+    }
+
+    lv_obj_t label = {};
+    view.decorate_font_obj(&label);
+
+    start = std::chrono::steady_clock::now();
+    result.glyph_cnt = fetch_first_frame(label.text_font);
+    result.fetch_us = elapsed_us(start);
+    return result;
+}
+
+static bool run_boots(const char *font_path, const char *dir, bool hot_set, uint32_t boots, boot_result *avg_out)
+{
+    *avg_out = {};
+    for (uint32_t idx = 0; idx < boots; idx += 1) {
+        int fds[2] = {};
+        if (pipe(fds) != 0) {
+            return false;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            auto result = boot(font_path, dir, hot_set);
+            bool ok = write(fds[1], &result, sizeof(result)) == sizeof(result);
+            _exit(ok ? 0 : 1);
+        }
+
+        close(fds[1]);
+        boot_result result = {};
+        bool ok = read(fds[0], &result, sizeof(result)) == sizeof(result);
+        close(fds[0]);
+
+        int status = 0;
+        waitpid(pid, &status, 0);
+        if (!ok || result.glyph_cnt == 0) {
+            return false;
+        }
+
+        avg_out->load_us += result.load_us / boots;
+        avg_out->fetch_us += result.fetch_us / boots;
+        avg_out->glyph_cnt = result.glyph_cnt;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <font.ttf> [boots]\n", argv[0]);
+        return 1;
+    }
+
+    uint32_t boots = argc > 2 ? (uint32_t)strtoul(argv[2], nullptr, 10) : BENCH_DEFAULT_BOOTS;
+    if (boots < 1) {
+        boots = 1;
+    }
+
+    char dir[] = "/tmp/ft_warm_boot_XXXXXX";
+    if (mkdtemp(dir) == nullptr) {
+        fprintf(stderr, "Failed to create a cache dir\n");
+        return 1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(populate(argv[1], dir));
+    }
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Failed to populate %s from %s\n", dir, argv[1]);
+        return 1;
+    }
+
+    boot_result per_glyph = {};
+    boot_result hot_set = {};
+    if (!run_boots(argv[1], dir, false, boots, &per_glyph) || !run_boots(argv[1], dir, true, boots, &hot_set)) {
+        fprintf(stderr, "Boot failed\n");
+        return 1;
+    }
+
+    printf("boots: %lu, first-frame glyphs: %lu, cache dir: %s\n", (unsigned long)boots, (unsigned long)hot_set.glyph_cnt, dir);
+    printf("per-glyph get_bitmap:   load %8.1f us, first frame %8.1f us, total %8.1f us\n",
+           per_glyph.load_us, per_glyph.fetch_us, per_glyph.load_us + per_glyph.fetch_us);
+    printf("hot-set add_renderer:   load %8.1f us, first frame %8.1f us, total %8.1f us\n",
+           hot_set.load_us, hot_set.fetch_us, hot_set.load_us + hot_set.fetch_us);
+
+    return 0;
+}
@@ -1,11 +1,24 @@
+#include <algorithm>
+#include <cstring>
 #include <esp_heap_caps.h>
 #include <esp_log.h>
 #include <esp_timer.h>
 
 #include "font_cacher.hpp"
+#include "font_mem_governor.hpp"
+
+font_cacher::font_cacher()
+{
+    cache_lock = xSemaphoreCreateRecursiveMutex();
+}
 
 esp_err_t font_cacher::init(size_t buf_size, size_t glyph_cnt)
 {
+    if (cache_lock == nullptr) {
+        ESP_LOGE(TAG, "Lock create failed");
+        return ESP_ERR_NO_MEM;
+    }
+
     if (cache_size != 0 || cached_glyphs != nullptr) {
         ESP_LOGE(TAG, "Font cacher already initialised");
         return ESP_ERR_INVALID_STATE;
@@ -31,7 +44,12 @@ esp_err_t font_cacher::init(size_t buf_size, size_t glyph_cnt)
     glyph_slot_size = glyph_cnt;
     cache_used = 0;
 
-    return ESP_OK;
+    return font_mem_governor::instance().register_reclaimer(reclaim_handler, this);
+}
+
+bool font_cacher::is_inited()
+{
+    return cached_glyphs != nullptr;
 }
 
 uint32_t font_cacher::get_new_renderer_id()
@@ -45,13 +63,17 @@ uint32_t font_cacher::get_new_renderer_id()
 
 bool font_cacher::has_cache(uint32_t renderer_id, uint32_t codepoint)
 {
+    bool ret = false;
+    xSemaphoreTakeRecursive(cache_lock, portMAX_DELAY);
     for (size_t idx = 0; idx < glyph_slot_size; idx += 1) {
-        if (cached_glyphs[idx].codepoint == codepoint && cached_glyphs[idx].renderer_instance_id == renderer_id) {
-            return true;
+        if (cached_glyphs[idx].bitmap != nullptr && cached_glyphs[idx].codepoint == codepoint && cached_glyphs[idx].renderer_instance_id == renderer_id) {
+            ret = true;
+            break;
         }
     }
 
-    return false;
+    xSemaphoreGiveRecursive(cache_lock);
+    return ret;
 }
 
 esp_err_t font_cacher::get_cache(uint32_t renderer_id, uint32_t codepoint, glyph_item *out)
@@ -60,27 +82,75 @@ esp_err_t font_cacher::get_cache(uint32_t renderer_id, uint32_t codepoint, glyph
         return ESP_ERR_INVALID_ARG;
     }
 
+    // NOTE: out->bitmap may be evicted once this returns, use copy_cache() unless the caller holds off reclaims itself
+    xSemaphoreTakeRecursive(cache_lock, portMAX_DELAY);
     for (size_t idx = 0; idx < glyph_slot_size; idx += 1) {
-        if (cached_glyphs[idx].codepoint == codepoint && cached_glyphs[idx].renderer_instance_id == renderer_id) {
-            out->bitmap = cached_glyphs[idx].bitmap;
-            out->last_used = cached_glyphs[idx].last_used;
-            out->renderer_instance_id = cached_glyphs[idx].renderer_instance_id;
-            out->codepoint = cached_glyphs[idx].codepoint;
-            out->len = cached_glyphs[idx].len;
+        if (cached_glyphs[idx].bitmap != nullptr && cached_glyphs[idx].codepoint == codepoint && cached_glyphs[idx].renderer_instance_id == renderer_id) {
+            cached_glyphs[idx].last_used = esp_timer_get_time();
+            if (cached_glyphs[idx].access_cnt < UINT32_MAX) {
+                cached_glyphs[idx].access_cnt += 1;
+            }
 
+            *out = cached_glyphs[idx];
+            generation += 1;
+            xSemaphoreGiveRecursive(cache_lock);
             return ESP_OK;
         }
     }
 
+    xSemaphoreGiveRecursive(cache_lock);
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t font_cacher::copy_cache(uint32_t renderer_id, uint32_t codepoint, uint8_t *buf_out, size_t len, size_t *len_out, bool touch)
+{
+    if (buf_out == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTakeRecursive(cache_lock, portMAX_DELAY);
+    for (size_t idx = 0; idx < glyph_slot_size; idx += 1) {
+        auto *item = &cached_glyphs[idx];
+        if (item->bitmap == nullptr || item->codepoint != codepoint || item->renderer_instance_id != renderer_id) {
+            continue;
+        }
+
+        // Snapshots (e.g. the hot set) read without touching, so they don't count as a use
+        if (touch) {
+            item->last_used = esp_timer_get_time();
+            if (item->access_cnt < UINT32_MAX) {
+                item->access_cnt += 1;
+            }
+
+            generation += 1;
+        }
+
+        memcpy(buf_out, item->bitmap, std::min(len, item->len));
+        if (len_out != nullptr) {
+            *len_out = item->len;
+        }
+
+        xSemaphoreGiveRecursive(cache_lock);
+        return ESP_OK;
+    }
+
+    xSemaphoreGiveRecursive(cache_lock);
     return ESP_ERR_NOT_FOUND;
 }
 
-esp_err_t font_cacher::add_cache(uint32_t renderer_id, uint32_t codepoint, uint8_t *buf_in, size_t buf_sz)
+esp_err_t font_cacher::add_cache(uint32_t renderer_id, uint32_t codepoint, uint8_t *buf_in, size_t buf_sz, uint32_t access_cnt)
 {
     size_t idx = 0;
 
+    if (cached_glyphs == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // buf_in was already drawn from the budget by alloc_bitmap(), this only enforces the cache's own limits
+    xSemaphoreTakeRecursive(cache_lock, portMAX_DELAY);
     auto ret = make_room(&idx, buf_sz);
     if (ret != ESP_OK) {
+        xSemaphoreGiveRecursive(cache_lock);
         return ret;
     }
 
@@ -89,61 +159,219 @@ esp_err_t font_cacher::add_cache(uint32_t renderer_id, uint32_t codepoint, uint8
     cached_glyphs[idx].codepoint = codepoint;
     cached_glyphs[idx].len = buf_sz;
     cached_glyphs[idx].renderer_instance_id = renderer_id;
+    cached_glyphs[idx].access_cnt = access_cnt;
 
     cache_used += buf_sz;
     glyph_slot_cnt += 1;
+    generation += 1;
 
+    xSemaphoreGiveRecursive(cache_lock);
     return ESP_OK;
 }
 
 esp_err_t font_cacher::make_room(size_t *free_idx, size_t space_needed)
 {
-    // Find the oldest
-    glyph_item *oldest_item = nullptr;
-    uint64_t oldest_ts = UINT64_MAX;
-    size_t pending_idx = 0;
+    if (space_needed > cache_size) {
+        ESP_LOGE(TAG, "Glyph larger than cache: %zu", space_needed);
+        return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreTakeRecursive(cache_lock, portMAX_DELAY);
+
+    // Evict until there's enough space, then until there's also a free slot
+    while (cache_size - cache_used < space_needed) {
+        if (evict_oldest() == 0) {
+            ESP_LOGE(TAG, "Failed to make room (mem corrupt)");
+            xSemaphoreGiveRecursive(cache_lock);
+            return ESP_ERR_NO_MEM;
+        }
+    }
 
-    // Loop to clear out enough space as per requested
-    do {
+    while (true) {
         for (size_t idx = 0; idx < glyph_slot_size; idx += 1) {
-            if (cached_glyphs[idx].bitmap == nullptr && cached_glyphs[idx].last_used == 0) {
+            if (cached_glyphs[idx].bitmap == nullptr) {
                 if (free_idx != nullptr) {
                     *free_idx = idx;
                 }
 
-                if (cache_size - cache_used >= space_needed) {
-                    return ESP_OK;
-                }
-            }
-
-            if (cached_glyphs[idx].last_used < oldest_ts) {
-                oldest_ts = cached_glyphs[idx].last_used;
-                oldest_item = &cached_glyphs[idx];
-                pending_idx = idx;
+                xSemaphoreGiveRecursive(cache_lock);
+                return ESP_OK;
             }
         }
 
-        if (oldest_item == nullptr) {
+        if (evict_oldest() == 0) {
             ESP_LOGE(TAG, "Failed to make room (mem corrupt)");
+            xSemaphoreGiveRecursive(cache_lock);
             return ESP_ERR_NO_MEM;
-        } else {
-            cache_used -= oldest_item->len;
-            glyph_slot_cnt -= 1;
-
-            oldest_item->last_used = 0;
-            oldest_item->renderer_instance_id = 0;
-            oldest_item->len = 0;
-            oldest_item->codepoint = 0;
-            if (oldest_item->bitmap != nullptr) {
-                free(oldest_item->bitmap);
-                oldest_item->bitmap = nullptr;
-            }
+        }
+    }
+}
 
-            if (free_idx != nullptr) {
-                *free_idx = pending_idx;
-            }
+esp_err_t font_cacher::preload_cache(uint32_t renderer_id, uint32_t codepoint, uint8_t *buf_in, size_t buf_sz, uint32_t access_cnt, uint64_t last_used)
+{
+    if (cached_glyphs == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (buf_in == nullptr || buf_sz < 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Unlike add_cache(), never evict anything: a preload must not push out what's already warm
+    xSemaphoreTakeRecursive(cache_lock, portMAX_DELAY);
+    size_t free_idx = SIZE_MAX;
+    for (size_t idx = 0; idx < glyph_slot_size; idx += 1) {
+        if (cached_glyphs[idx].bitmap == nullptr) {
+            free_idx = idx;
+            break;
         }
-    } while (cache_size - cache_used < space_needed);
+    }
+
+    if (free_idx == SIZE_MAX || cache_size - cache_used < buf_sz) {
+        xSemaphoreGiveRecursive(cache_lock);
+        return ESP_ERR_NO_MEM;
+    }
+
+    cached_glyphs[free_idx].last_used = last_used;
+    cached_glyphs[free_idx].bitmap = buf_in;
+    cached_glyphs[free_idx].codepoint = codepoint;
+    cached_glyphs[free_idx].len = buf_sz;
+    cached_glyphs[free_idx].renderer_instance_id = renderer_id;
+    cached_glyphs[free_idx].access_cnt = access_cnt;
+
+    cache_used += buf_sz;
+    glyph_slot_cnt += 1;
 
+    xSemaphoreGiveRecursive(cache_lock);
     return ESP_OK;
 }
+
+void font_cacher::age_access_cnt()
+{
+    xSemaphoreTakeRecursive(cache_lock, portMAX_DELAY);
+    for (size_t idx = 0; idx < glyph_slot_size; idx += 1) {
+        if (cached_glyphs[idx].bitmap != nullptr) {
+            cached_glyphs[idx].access_cnt = std::max<uint32_t>(1, cached_glyphs[idx].access_cnt / 2);
+        }
+    }
+
+    xSemaphoreGiveRecursive(cache_lock);
+}
+
+uint32_t font_cacher::get_generation()
+{
+    return generation;
+}
+
+uint8_t *font_cacher::alloc_bitmap(size_t len, bool allow_reclaim)
+{
+    return (uint8_t *)font_mem_governor::instance().alloc(FONT_MEM_CACHE, len, allow_reclaim);
+}
+
+void font_cacher::free_bitmap(uint8_t *bitmap, size_t len)
+{
+    font_mem_governor::instance().free(FONT_MEM_CACHE, bitmap, len);
+}
+
+size_t font_cacher::reclaim_handler(size_t bytes_wanted, void *ctx)
+{
+    auto *cacher = (font_cacher *)ctx;
+    if (cacher == nullptr || cacher->cached_glyphs == nullptr) {
+        return 0;
+    }
+
+    if (xSemaphoreTakeRecursive(cacher->cache_lock, 0) != pdTRUE) {
+        return 0;
+    }
+
+    size_t freed = 0;
+    while (freed < bytes_wanted) {
+        size_t evicted = cacher->evict_oldest();
+        if (evicted == 0) {
+            break;
+        }
+
+        freed += evicted;
+    }
+
+    xSemaphoreGiveRecursive(cacher->cache_lock);
+    ESP_LOGD(TAG, "Reclaimed %zu bytes", freed);
+    return freed;
+}
+
+size_t font_cacher::evict_oldest()
+{
+    glyph_item *oldest_item = nullptr;
+    uint64_t oldest_ts = UINT64_MAX;
+
+    for (size_t idx = 0; idx < glyph_slot_size; idx += 1) {
+        if (cached_glyphs[idx].bitmap == nullptr) {
+            continue;
+        }
+
+        if (cached_glyphs[idx].last_used < oldest_ts) {
+            oldest_ts = cached_glyphs[idx].last_used;
+            oldest_item = &cached_glyphs[idx];
+        }
+    }
+
+    if (oldest_item == nullptr) {
+        return 0;
+    }
+
+    size_t len = oldest_item->len;
+    cache_used -= len;
+    glyph_slot_cnt -= 1;
+    free_bitmap(oldest_item->bitmap, len);
+
+    oldest_item->last_used = 0;
+    oldest_item->renderer_instance_id = 0;
+    oldest_item->len = 0;
+    oldest_item->codepoint = 0;
+    oldest_item->access_cnt = 0;
+    oldest_item->bitmap = nullptr;
+
+    return len;
+}
+
+size_t font_cacher::get_hot_set(glyph_item *out, size_t max_cnt)
+{
+    if (out == nullptr || max_cnt < 1 || cached_glyphs == nullptr) {
+        return 0;
+    }
+
+    // Most frequently used first, most recently used breaks the tie
+    auto hotter = [](const glyph_item &a, const glyph_item &b) {
+        if (a.access_cnt != b.access_cnt) {
+            return a.access_cnt > b.access_cnt;
+        }
+
+        return a.last_used > b.last_used;
+    };
+
+    // Keep the top max_cnt in `out` as a heap with the coldest kept entry in front, no scratch array needed
+    size_t out_cnt = 0;
+    xSemaphoreTakeRecursive(cache_lock, portMAX_DELAY);
+    for (size_t idx = 0; idx < glyph_slot_size; idx += 1) {
+        if (cached_glyphs[idx].bitmap == nullptr) {
+            continue;
+        }
+
+        if (out_cnt < max_cnt) {
+            out[out_cnt] = cached_glyphs[idx];
+            out[out_cnt].bitmap = nullptr;
+            out_cnt += 1;
+            std::push_heap(out, out + out_cnt, hotter);
+        } else if (hotter(cached_glyphs[idx], out[0])) {
+            std::pop_heap(out, out + out_cnt, hotter);
+            out[out_cnt - 1] = cached_glyphs[idx];
+            out[out_cnt - 1].bitmap = nullptr;
+            std::push_heap(out, out + out_cnt, hotter);
+        }
+    }
+
+    xSemaphoreGiveRecursive(cache_lock);
+
+    std::sort_heap(out, out + out_cnt, hotter);
+    return out_cnt;
+}
@@ -1,12 +1,27 @@
 #include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <algorithm>
 #include <cstring>
 #include <dirent.h>
 #include <cerrno>
 #include <sys/stat.h>
 #include "font_disk_cacher.hpp"
+#include "font_cacher.hpp"
+#include "font_mem_governor.hpp"
 
 #define FT_DISK_CACHE_PATH_OVERHEAD 10
 #define FT_DISK_CACHE_DIR_PERMISSION 0777  // This is just a placeholder
+#define FT_HOT_SET_FILE_NAME "hotset.bin"
+#define FT_HOT_SET_TMP_FILE_NAME "hotset.tmp"
+#define FT_HOT_SET_IO_BUF_SIZE 4096
+#define FT_HOT_SET_TASK_STACK_SIZE 4096
+#define FT_HOT_SET_SHUTDOWN_WAIT_MS 500
+
+font_disk_cacher::font_disk_cacher()
+{
+    hot_set_lock = xSemaphoreCreateMutex();
+}
 
 esp_err_t font_disk_cacher::init(const char *_base_path, get_part_free_space_fn _free_space_getter_fn, void *_free_space_getter_ctx)
 {
@@ -30,6 +45,18 @@ esp_err_t font_disk_cacher::init(const char *_base_path, get_part_free_space_fn
     free_space_getter_fn = _free_space_getter_fn;
     get_free_space_fn_ctx = _free_space_getter_ctx;
 
+    if (hot_set_lock == nullptr) {
+        ESP_LOGE(TAG, "Lock create failed");
+        return ESP_ERR_NO_MEM;
+    }
+
+    xSemaphoreTake(hot_set_lock, portMAX_DELAY);
+    auto ret = load_hot_set_index();
+    xSemaphoreGive(hot_set_lock);
+    if (ret != ESP_OK && ret != ESP_ERR_NOT_FOUND) {
+        ESP_LOGW(TAG, "Hot set manifest ignored: 0x%x", ret);
+    }
+
     return ESP_OK;
 }
 
@@ -75,6 +102,39 @@ esp_err_t font_disk_cacher::add_renderer(const char *font_name, uint8_t font_siz
         dir = nullptr;
     }
 
+    // The autosave task walks renderers[] while holding the same lock
+    xSemaphoreTake(hot_set_lock, portMAX_DELAY);
+    if (find_renderer(font_name, font_size) != nullptr) {
+        xSemaphoreGive(hot_set_lock);
+        return ESP_OK;
+    }
+
+    if (renderer_cnt >= FT_DISK_CACHE_MAX_RENDERERS) {
+        xSemaphoreGive(hot_set_lock);
+        ESP_LOGE(TAG, "Too many renderers");
+        return ESP_ERR_NO_MEM;
+    }
+
+    auto &ram_cache = font_cacher::instance();
+    auto *renderer = &renderers[renderer_cnt];
+    renderer->font_name = strdup(font_name);
+    if (renderer->font_name == nullptr) {
+        xSemaphoreGive(hot_set_lock);
+        return ESP_ERR_NO_MEM;
+    }
+
+    renderer->font_size = font_size;
+    renderer->renderer_id = ram_cache.get_new_renderer_id();
+    renderer_cnt += 1;
+
+    if (ram_cache.is_inited()) {
+        auto ret = load_hot_set(renderer);
+        if (ret != ESP_OK && ret != ESP_ERR_NOT_FOUND) {
+            ESP_LOGW(TAG, "Hot set load failed for %s/%x: 0x%x", font_name, font_size, ret);
+        }
+    }
+
+    xSemaphoreGive(hot_set_lock);
     return ESP_OK;
 }
 
@@ -109,11 +169,20 @@ esp_err_t font_disk_cacher::add_bitmap(const char *font_name, uint8_t font_size,
     fflush(fp);
     fclose(fp);
 
+    add_to_ram_tier(font_name, font_size, codepoint, buf, len);
     return ESP_OK;
 }
 
 esp_err_t font_disk_cacher::get_bitmap(const char *font_name, uint8_t font_size, uint32_t codepoint, uint8_t *buf_out, size_t len, size_t *len_out)
 {
+    auto &ram_cache = font_cacher::instance();
+    auto *renderer = find_renderer(font_name, font_size);
+    if (renderer != nullptr && ram_cache.is_inited()) {
+        if (ram_cache.copy_cache(renderer->renderer_id, codepoint, buf_out, len, len_out) == ESP_OK) {
+            return ESP_OK;
+        }
+    }
+
     char combined_path[256] = { 0 };
 
     snprintf(combined_path, sizeof(combined_path), "%s/%s/%x/%lx", base_path, font_name, font_size, codepoint);
@@ -136,13 +205,16 @@ esp_err_t font_disk_cacher::get_bitmap(const char *font_name, uint8_t font_size,
         rewind(fp);
     }
 
-    if (fread(buf_out, 1, len, fp) < 1) {
+    size_t read_len = fread(buf_out, 1, len, fp);
+    if (read_len < 1) {
         ESP_LOGD(TAG, "Read op failed");
         fclose(fp);
         return ESP_FAIL;
     }
 
     fclose(fp);
+
+    add_to_ram_tier(font_name, font_size, codepoint, buf_out, read_len);
     return ESP_OK;
 }
 
@@ -151,3 +223,372 @@ esp_err_t font_disk_cacher::delete_all()
     return 0;
 }
 
+
+esp_err_t font_disk_cacher::set_hot_set_autosave(size_t max_entries, uint32_t interval_ms)
+{
+    if (max_entries < 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(hot_set_lock, portMAX_DELAY);
+    hot_set_max_entries = max_entries;
+    xSemaphoreGive(hot_set_lock);
+    hot_set_interval_ms = interval_ms;
+
+    auto ret = esp_register_shutdown_handler(shutdown_handler);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) { // INVALID_STATE: already registered
+        ESP_LOGE(TAG, "Failed to register shutdown handler: 0x%x", ret);
+        return ret;
+    }
+
+    // Periodic saves write to flash for a while, keep them off the LVGL task
+    if (interval_ms > 0 && hot_set_task_handle == nullptr) {
+        if (xTaskCreate(hot_set_task, "ft_hot_set", FT_HOT_SET_TASK_STACK_SIZE, this, tskIDLE_PRIORITY + 1, &hot_set_task_handle) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create hot set task");
+            hot_set_task_handle = nullptr;
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t font_disk_cacher::save_hot_set(TickType_t wait_ticks)
+{
+    auto &ram_cache = font_cacher::instance();
+    if (base_path == nullptr || !ram_cache.is_inited() || hot_set_lock == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (xSemaphoreTake(hot_set_lock, wait_ticks) != pdTRUE) {
+        ESP_LOGW(TAG, "Hot set busy, save skipped");
+        return ESP_ERR_TIMEOUT;
+    }
+
+    auto ret = save_hot_set_locked();
+    xSemaphoreGive(hot_set_lock);
+    return ret;
+}
+
+esp_err_t font_disk_cacher::save_hot_set_locked()
+{
+    auto &ram_cache = font_cacher::instance();
+    auto &governor = font_mem_governor::instance();
+
+    // Nothing was added or hit since the last save, don't wear the flash for an identical manifest
+    uint32_t generation = ram_cache.get_generation();
+    if (generation == hot_set_saved_gen) {
+        ESP_LOGD(TAG, "Hot set unchanged, save skipped");
+        return ESP_OK;
+    }
+
+    size_t max_entries = hot_set_max_entries;
+    auto *items = (glyph_item *)governor.alloc(FONT_MEM_CACHE, max_entries * sizeof(glyph_item), false);
+    if (items == nullptr) {
+        ESP_LOGE(TAG, "No mem for hot set");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Only (renderer, codepoint, len) is snapshotted, bitmaps are copied one at a time into io_buf while writing
+    size_t item_cnt = ram_cache.get_hot_set(items, max_entries);
+    size_t io_buf_len = 0;
+    for (size_t idx = 0; idx < item_cnt; idx += 1) {
+        if (items[idx].len <= UINT16_MAX) {
+            io_buf_len = std::max(io_buf_len, items[idx].len);
+        }
+    }
+
+    uint8_t *io_buf = nullptr;
+    if (io_buf_len > 0 && (io_buf = (uint8_t *)governor.alloc(FONT_MEM_CACHE, io_buf_len, false)) == nullptr) {
+        governor.free(FONT_MEM_CACHE, items, max_entries * sizeof(glyph_item));
+        ESP_LOGE(TAG, "No mem for hot set");
+        return ESP_ERR_NO_MEM;
+    }
+
+    char tmp_path[256] = { 0 };
+    char final_path[256] = { 0 };
+    snprintf(tmp_path, sizeof(tmp_path), "%s/%s", base_path, FT_HOT_SET_TMP_FILE_NAME);
+    snprintf(final_path, sizeof(final_path), "%s/%s", base_path, FT_HOT_SET_FILE_NAME);
+
+    hot_set_header header = {};
+    header.magic = FT_HOT_SET_MAGIC;
+    header.version = FT_HOT_SET_VERSION;
+
+    size_t written_total = 0;
+    bool write_ok = false;
+    FILE *fp = fopen(tmp_path, "wb");
+    if (fp == nullptr) {
+        ESP_LOGE(TAG, "Failed to open path: %s, errno %d", tmp_path, errno);
+    } else {
+        setvbuf(fp, nullptr, _IOFBF, FT_HOT_SET_IO_BUF_SIZE);
+
+        // Headers are written as placeholders and patched once the real counts are known:
+        // entries evicted since the snapshot are left out
+        write_ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+        for (size_t idx = 0; idx < renderer_cnt && write_ok; idx += 1) {
+            size_t name_len = strlen(renderers[idx].font_name);
+            bool has_entries = false;
+            for (size_t item_idx = 0; item_idx < item_cnt && !has_entries; item_idx += 1) {
+                has_entries = items[item_idx].renderer_instance_id == renderers[idx].renderer_id;
+            }
+
+            if (name_len > UINT8_MAX || !has_entries) {
+                continue;
+            }
+
+            hot_set_section section = {};
+            section.font_size = renderers[idx].font_size;
+            section.name_len = (uint8_t)name_len;
+
+            long section_pos = ftell(fp);
+            write_ok = section_pos >= 0 && fwrite(&section, sizeof(section), 1, fp) == 1
+                    && fwrite(renderers[idx].font_name, 1, section.name_len, fp) == section.name_len;
+
+            for (size_t item_idx = 0; item_idx < item_cnt && write_ok && section.entry_cnt < UINT16_MAX; item_idx += 1) {
+                if (items[item_idx].renderer_instance_id != renderers[idx].renderer_id || items[item_idx].len > UINT16_MAX) {
+                    continue;
+                }
+
+                // Read without touching: the save must not make what it saves look hotter
+                size_t len = 0;
+                if (ram_cache.copy_cache(renderers[idx].renderer_id, items[item_idx].codepoint, io_buf, io_buf_len, &len, false) != ESP_OK
+                    || len > io_buf_len) {
+                    continue;
+                }
+
+                // Counts are halved on every save so glyphs that were hot long ago fade out of the manifest
+                hot_set_entry entry = {};
+                entry.codepoint = items[item_idx].codepoint;
+                entry.access_cnt = std::max<uint32_t>(1, items[item_idx].access_cnt / 2);
+                entry.len = (uint16_t)len;
+
+                write_ok = fwrite(&entry, sizeof(entry), 1, fp) == 1 && fwrite(io_buf, 1, entry.len, fp) == entry.len;
+                section.entry_cnt += 1;
+                section.payload_len += sizeof(hot_set_entry) + entry.len;
+            }
+
+            write_ok = write_ok && fseek(fp, section_pos, SEEK_SET) == 0 && fwrite(&section, sizeof(section), 1, fp) == 1
+                    && fseek(fp, 0, SEEK_END) == 0;
+            header.section_cnt += 1;
+            written_total += section.entry_cnt;
+        }
+
+        write_ok = write_ok && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+        fflush(fp);
+        fclose(fp);
+    }
+
+    governor.free(FONT_MEM_CACHE, io_buf, io_buf_len);
+    governor.free(FONT_MEM_CACHE, items, max_entries * sizeof(glyph_item));
+
+    if (!write_ok) {
+        ESP_LOGE(TAG, "Failed to write hot set");
+        remove(tmp_path);
+        return ESP_FAIL;
+    }
+
+    // FAT can't rename over an existing file; if power drops in between, load_hot_set_index() picks up the tmp file
+    remove(final_path);
+    if (rename(tmp_path, final_path) != 0) {
+        ESP_LOGE(TAG, "Failed to rename hot set, errno %d", errno);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    hot_set_saved_gen = generation;
+    ram_cache.age_access_cnt();
+    ESP_LOGI(TAG, "Hot set saved: %zu glyphs, %u fonts", written_total, header.section_cnt);
+
+    // Section offsets changed, renderers added from now on must read the new file
+    return load_hot_set_index();
+}
+
+void font_disk_cacher::hot_set_task(void *ctx)
+{
+    auto *cacher = (font_disk_cacher *)ctx;
+
+    while (cacher->hot_set_interval_ms > 0) {
+        vTaskDelay(pdMS_TO_TICKS(cacher->hot_set_interval_ms));
+        if (cacher->hot_set_interval_ms > 0) {
+            cacher->save_hot_set();
+        }
+    }
+
+    cacher->hot_set_task_handle = nullptr;
+    vTaskDelete(nullptr);
+}
+
+void font_disk_cacher::shutdown_handler()
+{
+    // Whatever task calls esp_restart() ends up here; don't hang the restart behind a save in progress
+    instance().save_hot_set(pdMS_TO_TICKS(FT_HOT_SET_SHUTDOWN_WAIT_MS));
+}
+
+disk_renderer_item *font_disk_cacher::find_renderer(const char *font_name, uint8_t font_size)
+{
+    for (size_t idx = 0; idx < renderer_cnt; idx += 1) {
+        if (renderers[idx].font_size == font_size && strcmp(renderers[idx].font_name, font_name) == 0) {
+            return &renderers[idx];
+        }
+    }
+
+    return nullptr;
+}
+
+void font_disk_cacher::add_to_ram_tier(const char *font_name, uint8_t font_size, uint32_t codepoint, const uint8_t *buf, size_t len)
+{
+    auto &ram_cache = font_cacher::instance();
+    auto *renderer = find_renderer(font_name, font_size);
+    if (renderer == nullptr || !ram_cache.is_inited() || ram_cache.has_cache(renderer->renderer_id, codepoint)) {
+        return;
+    }
+
+    auto *bitmap = font_cacher::alloc_bitmap(len);
+    if (bitmap == nullptr) {
+        return;
+    }
+
+    memcpy(bitmap, buf, len);
+    if (ram_cache.add_cache(renderer->renderer_id, codepoint, bitmap, len) != ESP_OK) {
+        font_cacher::free_bitmap(bitmap, len);
+    }
+}
+
+esp_err_t font_disk_cacher::load_hot_set_index()
+{
+    for (size_t idx = 0; idx < hot_set_section_cnt; idx += 1) {
+        free(hot_set_sections[idx].font_name);
+        hot_set_sections[idx] = {};
+    }
+
+    hot_set_section_cnt = 0;
+
+    char combined_path[256] = { 0 };
+    snprintf(combined_path, sizeof(combined_path), "%s/%s", base_path, FT_HOT_SET_FILE_NAME);
+
+    FILE *fp = fopen(combined_path, "rb");
+    if (fp == nullptr) {
+        // Power lost between removing the old manifest and renaming the new one: the tmp file is complete
+        char tmp_path[256] = { 0 };
+        snprintf(tmp_path, sizeof(tmp_path), "%s/%s", base_path, FT_HOT_SET_TMP_FILE_NAME);
+        if (rename(tmp_path, combined_path) == 0) {
+            ESP_LOGW(TAG, "Hot set recovered from %s", tmp_path);
+            fp = fopen(combined_path, "rb");
+        }
+    }
+
+    if (fp == nullptr) {
+        ESP_LOGD(TAG, "No hot set at %s", combined_path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    hot_set_header header = {};
+    if (fread(&header, sizeof(header), 1, fp) != 1 || header.magic != FT_HOT_SET_MAGIC || header.version != FT_HOT_SET_VERSION) {
+        ESP_LOGW(TAG, "Invalid hot set header");
+        fclose(fp);
+        return ESP_ERR_INVALID_VERSION;
+    }
+
+    // Only section headers are read here, payloads are skipped until their renderer shows up
+    for (size_t idx = 0; idx < header.section_cnt && hot_set_section_cnt < FT_DISK_CACHE_MAX_RENDERERS; idx += 1) {
+        hot_set_section section = {};
+        char font_name[UINT8_MAX + 1] = { 0 };
+        if (fread(&section, sizeof(section), 1, fp) != 1 || fread(font_name, 1, section.name_len, fp) != section.name_len) {
+            ESP_LOGW(TAG, "Hot set truncated");
+            break;
+        }
+
+        auto *item = &hot_set_sections[hot_set_section_cnt];
+        item->font_name = strdup(font_name);
+        item->font_size = section.font_size;
+        item->entry_cnt = section.entry_cnt;
+        item->offset = ftell(fp);
+        if (item->font_name == nullptr) {
+            fclose(fp);
+            return ESP_ERR_NO_MEM;
+        }
+
+        hot_set_section_cnt += 1;
+        if (fseek(fp, section.payload_len, SEEK_CUR) != 0) {
+            break;
+        }
+    }
+
+    fclose(fp);
+    return ESP_OK;
+}
+
+esp_err_t font_disk_cacher::load_hot_set(const disk_renderer_item *renderer)
+{
+    const hot_set_section_item *section = nullptr;
+    for (size_t idx = 0; idx < hot_set_section_cnt; idx += 1) {
+        if (hot_set_sections[idx].font_size == renderer->font_size && strcmp(hot_set_sections[idx].font_name, renderer->font_name) == 0) {
+            section = &hot_set_sections[idx];
+            break;
+        }
+    }
+
+    if (section == nullptr) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    char combined_path[256] = { 0 };
+    snprintf(combined_path, sizeof(combined_path), "%s/%s", base_path, FT_HOT_SET_FILE_NAME);
+
+    FILE *fp = fopen(combined_path, "rb");
+    if (fp == nullptr) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    setvbuf(fp, nullptr, _IOFBF, FT_HOT_SET_IO_BUF_SIZE);
+    if (fseek(fp, section->offset, SEEK_SET) != 0) {
+        fclose(fp);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // One sequential pass over this renderer's section instead of one file open per glyph
+    auto &ram_cache = font_cacher::instance();
+    uint64_t start_ts = esp_timer_get_time();
+    size_t loaded_cnt = 0;
+    esp_err_t ret = ESP_OK;
+
+    for (size_t idx = 0; idx < section->entry_cnt; idx += 1) {
+        hot_set_entry entry = {};
+        if (fread(&entry, sizeof(entry), 1, fp) != 1) {
+            ret = ESP_FAIL;
+            break;
+        }
+
+        if (ram_cache.has_cache(renderer->renderer_id, entry.codepoint)) {
+            fseek(fp, entry.len, SEEK_CUR);
+            continue;
+        }
+
+        // Preloading must not push anything else out of the budget, stop once it runs dry
+        auto *bitmap = font_cacher::alloc_bitmap(entry.len, false);
+        if (bitmap == nullptr) {
+            break;
+        }
+
+        if (fread(bitmap, 1, entry.len, fp) != entry.len) {
+            font_cacher::free_bitmap(bitmap, entry.len);
+            ret = ESP_FAIL;
+            break;
+        }
+
+        // Entries are stored hottest first: seed last_used by rank so LRU evicts the coldest ones first.
+        // Preloading never evicts, so once the tier is full the rest (colder) stays on disk.
+        uint64_t last_used = start_ts > idx ? start_ts - idx : 0;
+        if (ram_cache.preload_cache(renderer->renderer_id, entry.codepoint, bitmap, entry.len, entry.access_cnt, last_used) != ESP_OK) {
+            font_cacher::free_bitmap(bitmap, entry.len);
+            break;
+        }
+
+        loaded_cnt += 1;
+    }
+
+    fclose(fp);
+    ESP_LOGI(TAG, "Hot set: %zu/%u glyphs for %s/%x loaded in %llu us", loaded_cnt, section->entry_cnt,
+             renderer->font_name, renderer->font_size, esp_timer_get_time() - start_ts);
+
+    return ret;
+}
@@ -0,0 +1,302 @@
+#include <algorithm>
+#include <cstring>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+
+#include "font_mem_governor.hpp"
+
+font_mem_governor::font_mem_governor()
+{
+    scratch_lock = xSemaphoreCreateMutex();
+    state_lock = xSemaphoreCreateMutex();
+    reclaim_lock = xSemaphoreCreateRecursiveMutex();
+}
+
+esp_err_t font_mem_governor::init(size_t _budget, size_t _scratch_size)
+{
+    if (_budget < 1 || _scratch_size < 1) {
+        ESP_LOGE(TAG, "Invalid size arg");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (scratch_lock == nullptr || state_lock == nullptr || reclaim_lock == nullptr) {
+        ESP_LOGE(TAG, "Lock create failed");
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Scratch size can't be changed while the pool is lent out
+    if (_scratch_size != scratch_size) {
+        trim_scratch();
+        if (xSemaphoreTake(scratch_lock, 0) != pdTRUE) {
+            ESP_LOGE(TAG, "Scratch pool is in use");
+            return ESP_ERR_INVALID_STATE;
+        }
+
+        scratch_size = _scratch_size;
+        xSemaphoreGive(scratch_lock);
+    }
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    budget = _budget;
+    bool over_budget = total_used > budget;
+    size_t excess = over_budget ? (total_used - budget) : 0;
+    xSemaphoreGive(state_lock);
+
+    if (over_budget && reclaim(excess) < excess) {
+        ESP_LOGW(TAG, "Still over budget after reclaim: %zu bytes", excess);
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t font_mem_governor::reserve(font_mem_component comp, size_t len, bool allow_reclaim)
+{
+    if (comp >= FONT_MEM_COMPONENT_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    while (true) {
+        xSemaphoreTake(state_lock, portMAX_DELAY);
+        if (len > budget) {
+            xSemaphoreGive(state_lock);
+            ESP_LOGE(TAG, "Request %zu larger than budget %zu", len, budget);
+            return ESP_ERR_NO_MEM;
+        }
+
+        // The budget may have been lowered below what's already in use, don't let that underflow
+        if (total_used <= budget && len <= budget - total_used) {
+            total_used += len;
+            comp_used[comp] += len;
+            xSemaphoreGive(state_lock);
+            return ESP_OK;
+        }
+
+        size_t needed = total_used + len - budget;
+        xSemaphoreGive(state_lock);
+
+        if (!allow_reclaim) {
+            return ESP_ERR_NO_MEM;
+        }
+
+        // Reclaimers call release() themselves, so the state lock must not be held here
+        if (reclaim(needed) == 0) {
+            ESP_LOGE(TAG, "Out of budget: comp %u wants %zu, used %zu/%zu", comp, len, total_used, budget);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+}
+
+void font_mem_governor::release(font_mem_component comp, size_t len)
+{
+    if (comp >= FONT_MEM_COMPONENT_MAX) {
+        return;
+    }
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    if (comp_used[comp] < len || total_used < len) {
+        ESP_LOGW(TAG, "Release underflow: comp %u, %zu > %zu", comp, len, comp_used[comp]);
+        total_used -= std::min(total_used, comp_used[comp]);
+        comp_used[comp] = 0;
+    } else {
+        comp_used[comp] -= len;
+        total_used -= len;
+    }
+    xSemaphoreGive(state_lock);
+}
+
+void *font_mem_governor::alloc(font_mem_component comp, size_t len, bool allow_reclaim)
+{
+    if (reserve(comp, len, allow_reclaim) != ESP_OK) {
+        return nullptr;
+    }
+
+#ifdef CONFIG_SPIRAM
+    void *ret = heap_caps_malloc(len, MALLOC_CAP_SPIRAM);
+#else
+    void *ret = malloc(len);
+#endif
+
+    if (ret == nullptr) {
+        ESP_LOGE(TAG, "No mem for %zu bytes", len);
+        release(comp, len);
+    }
+
+    return ret;
+}
+
+void font_mem_governor::free(font_mem_component comp, void *ptr, size_t len)
+{
+    if (ptr == nullptr) {
+        return;
+    }
+
+    ::free(ptr);
+    release(comp, len);
+}
+
+esp_err_t font_mem_governor::register_reclaimer(font_mem_reclaim_fn fn, void *ctx)
+{
+    if (fn == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    for (auto &item : reclaimers) {
+        if (item.fn == fn && item.ctx == ctx) {
+            xSemaphoreGive(state_lock);
+            return ESP_OK;
+        }
+    }
+
+    for (auto &item : reclaimers) {
+        if (item.fn == nullptr) {
+            item.fn = fn;
+            item.ctx = ctx;
+            xSemaphoreGive(state_lock);
+            return ESP_OK;
+        }
+    }
+
+    xSemaphoreGive(state_lock);
+    ESP_LOGE(TAG, "Too many reclaimers");
+    return ESP_ERR_NO_MEM;
+}
+
+esp_err_t font_mem_governor::unregister_reclaimer(font_mem_reclaim_fn fn, void *ctx)
+{
+    // A reclaim may be calling into ctx from a snapshot right now, so wait it out before ctx goes away
+    xSemaphoreTakeRecursive(reclaim_lock, portMAX_DELAY);
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    for (auto &item : reclaimers) {
+        if (item.fn == fn && item.ctx == ctx) {
+            item.fn = nullptr;
+            item.ctx = nullptr;
+            ret = ESP_OK;
+            break;
+        }
+    }
+
+    xSemaphoreGive(state_lock);
+    xSemaphoreGiveRecursive(reclaim_lock);
+    return ret;
+}
+
+multi_heap_handle_t font_mem_governor::acquire_scratch(TickType_t wait_ticks)
+{
+    if (scratch_lock == nullptr || xSemaphoreTake(scratch_lock, wait_ticks) != pdTRUE) {
+        ESP_LOGE(TAG, "Scratch pool busy");
+        return nullptr;
+    }
+
+    if (scratch_pool == nullptr) {
+        if (reserve(FONT_MEM_SCRATCH, scratch_size) != ESP_OK) {
+            xSemaphoreGive(scratch_lock);
+            return nullptr;
+        }
+
+        scratch_pool = (uint8_t *)heap_caps_aligned_calloc(4, scratch_size, 1, MALLOC_CAP_SPIRAM);
+        if (scratch_pool == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate scratch pool");
+            release(FONT_MEM_SCRATCH, scratch_size);
+            xSemaphoreGive(scratch_lock);
+            return nullptr;
+        }
+    }
+
+    // Every borrower frees all it allocated before handing the pool back, so start from a clean heap each time
+    scratch_heap = multi_heap_register(scratch_pool, scratch_size);
+    if (scratch_heap == nullptr) {
+        ESP_LOGE(TAG, "Heap pool add fail");
+        xSemaphoreGive(scratch_lock);
+        return nullptr;
+    }
+
+    return scratch_heap;
+}
+
+void font_mem_governor::release_scratch()
+{
+    scratch_heap = nullptr;
+    xSemaphoreGive(scratch_lock);
+}
+
+size_t font_mem_governor::get_usage(font_mem_component comp)
+{
+    if (comp >= FONT_MEM_COMPONENT_MAX) {
+        return 0;
+    }
+
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    size_t ret = comp_used[comp];
+    xSemaphoreGive(state_lock);
+    return ret;
+}
+
+size_t font_mem_governor::get_total_usage()
+{
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    size_t ret = total_used;
+    xSemaphoreGive(state_lock);
+    return ret;
+}
+
+size_t font_mem_governor::get_budget()
+{
+    return budget;
+}
+
+size_t font_mem_governor::reclaim(size_t bytes_wanted)
+{
+    // Held across the callbacks so unregister_reclaimer() can't return while one of them still runs
+    xSemaphoreTakeRecursive(reclaim_lock, portMAX_DELAY);
+
+    font_mem_reclaimer snapshot[FT_MEM_MAX_RECLAIMERS] = {};
+    xSemaphoreTake(state_lock, portMAX_DELAY);
+    memcpy(snapshot, reclaimers, sizeof(snapshot));
+    xSemaphoreGive(state_lock);
+
+    // Caches go first, the idle scratch pool is the last resort as the next render has to allocate it again
+    size_t freed = 0;
+    for (auto &item : snapshot) {
+        if (freed >= bytes_wanted) {
+            break;
+        }
+
+        if (item.fn != nullptr) {
+            freed += item.fn(bytes_wanted - freed, item.ctx);
+        }
+    }
+
+    xSemaphoreGiveRecursive(reclaim_lock);
+
+    if (freed < bytes_wanted) {
+        freed += trim_scratch();
+    }
+
+    ESP_LOGD(TAG, "Reclaimed %zu of %zu bytes", freed, bytes_wanted);
+    return freed;
+}
+
+size_t font_mem_governor::trim_scratch()
+{
+    // Don't wait: if the pool is lent out (maybe even to our own caller) it can't go away now
+    if (scratch_lock == nullptr || xSemaphoreTake(scratch_lock, 0) != pdTRUE) {
+        return 0;
+    }
+
+    if (scratch_pool == nullptr) {
+        xSemaphoreGive(scratch_lock);
+        return 0;
+    }
+
+    heap_caps_free(scratch_pool);
+    scratch_pool = nullptr;
+    scratch_heap = nullptr;
+    size_t freed = scratch_size;
+    xSemaphoreGive(scratch_lock);
+
+    release(FONT_MEM_SCRATCH, freed);
+    return freed;
+}
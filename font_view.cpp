@@ -2,18 +2,21 @@
 #include <cstdint>
 
 #include <multi_heap.h>
+#include <esp_timer.h>
 
 #include <font_view.hpp>
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include <stb_truetype.h>
 
-#define STBTT_MEM_INCREMENT_SIZE (98304)
-
 font_view::font_view(const char *_name, bool _disable_cache)
 {
     name = strdup(_name);
     disable_cache = _disable_cache;
+    layout_lock = xSemaphoreCreateRecursiveMutex();
+    if (font_mem_governor::instance().register_reclaimer(layout_reclaim_handler, this) != ESP_OK) {
+        ESP_LOGW(TAG, "Layout cache of %s won't be reclaimable", _name);
+    }
 }
 
 bool font_view::get_glyph_dsc_handler(const lv_font_t *font, lv_font_glyph_dsc_t *dsc_out, uint32_t unicode_letter, uint32_t unicode_letter_next)
@@ -68,28 +71,25 @@ const uint8_t *font_view::get_glyph_bitmap_handler(const lv_font_t *font, uint32
     }
 
     auto *ctx = (font_view *)font->user_data;
-    float scale = ctx->scale;
 
     ESP_LOGD(TAG, "Find glyph 0x%lx, %p", unicode_letter, ctx->font_buf);
 
     if (ctx->disable_cache) {
-        int width = 0, height = 0;
-        if (stbtt_GetCodepointBitmapPtr(&ctx->stb_font, scale, scale, (int)unicode_letter, ctx->font_buf, &width, &height, nullptr, nullptr)) {
+        if (ctx->render_glyph(unicode_letter)) {
             return ctx->font_buf;
         } else {
             return nullptr;
         }
     } else {
         auto &cache = font_disk_cacher::instance();
-        auto ret = cache.get_bitmap(ctx->name, ctx->height_px, unicode_letter, ctx->font_buf, (ctx->height_px * ctx->height_px), nullptr);
-        int width = 0, height = 0;
+        auto ret = cache.get_bitmap(ctx->name, ctx->height_px, unicode_letter, ctx->font_buf, ctx->font_buf_len, nullptr);
         if (ret == ESP_OK) {
             ESP_LOGD(TAG, "Cache match!");
             return ctx->font_buf;
         } else if (ret == ESP_ERR_NOT_FOUND) {
             ESP_LOGD(TAG, "Cache miss!");
-            if (stbtt_GetCodepointBitmapPtr(&ctx->stb_font, scale, scale, (int)unicode_letter, ctx->font_buf, &width, &height, nullptr, nullptr)) {
-                cache.add_bitmap(ctx->name, ctx->height_px, unicode_letter, ctx->font_buf, (ctx->height_px * ctx->height_px));
+            if (ctx->render_glyph(unicode_letter)) {
+                cache.add_bitmap(ctx->name, ctx->height_px, unicode_letter, ctx->font_buf, ctx->font_buf_len);
                 ESP_LOGD(TAG, "Cache added!");
                 return ctx->font_buf;
             } else {
@@ -105,6 +105,25 @@ const uint8_t *font_view::get_glyph_bitmap_handler(const lv_font_t *font, uint32
     return nullptr;
 }
 
+bool font_view::render_glyph(uint32_t unicode_letter)
+{
+    // Scratch is lent only for the duration of one rasterisation, all views share the same pool
+    auto &governor = font_mem_governor::instance();
+    heap = governor.acquire_scratch();
+    if (heap == nullptr) {
+        ESP_LOGE(TAG, "Failed to borrow scratch pool");
+        return false;
+    }
+
+    int width = 0, height = 0;
+    used_mem = 0;
+    bool ret = stbtt_GetCodepointBitmapPtr(&stb_font, scale, scale, (int)unicode_letter, font_buf, &width, &height, nullptr, nullptr);
+
+    heap = nullptr;
+    governor.release_scratch();
+    return ret;
+}
+
 esp_err_t font_view::init(const uint8_t *buf, size_t len, uint8_t _height_px)
 {
     height_px = _height_px;
@@ -134,28 +153,18 @@ esp_err_t font_view::init(const uint8_t *buf, size_t len, uint8_t _height_px)
         }
     }
 
-    ESP_LOGD(TAG, "Allocating font buffer size %u bytes", _height_px * _height_px);
+    font_buf_len = _height_px * _height_px;
+    ESP_LOGD(TAG, "Allocating font buffer size %zu bytes", font_buf_len);
 
-    font_buf = (uint8_t *)heap_caps_malloc(_height_px * _height_px, MALLOC_CAP_SPIRAM);
+    font_buf = (uint8_t *)font_mem_governor::instance().alloc(FONT_MEM_VIEW, font_buf_len);
     if (font_buf == nullptr) {
         ESP_LOGE(TAG, "Failed to allocate font buffer");
+        font_buf_len = 0;
         return ESP_ERR_NO_MEM;
     }
 
-    memset(font_buf, 0, _height_px * _height_px);
-
-    mem_pool = (uint8_t *)heap_caps_aligned_calloc(4, STBTT_MEM_INCREMENT_SIZE, 1, MALLOC_CAP_SPIRAM);
-    if (mem_pool == nullptr) {
-        ESP_LOGE(TAG, "Failed to allocate heap buffer");
-        return ESP_ERR_NO_MEM;
-    } else {
-        heap = multi_heap_register(mem_pool, STBTT_MEM_INCREMENT_SIZE);
-        tlsf_inited = true;
-        if (heap == nullptr) {
-            ESP_LOGE(TAG, "Heap pool add fail");
-            return ESP_ERR_NO_MEM;
-        }
-    }
+    memset(font_buf, 0, font_buf_len);
+    clear_layout_cache();
 
     scale = stbtt_ScaleForPixelHeight(&stb_font, height_px);
 
@@ -208,15 +217,9 @@ esp_err_t font_view::init(const char *file_path, uint8_t _height_px)
 void *font_view::stbtt_mem_alloc(size_t len, void *_ctx)
 {
     auto *ctx = (font_view *)(_ctx);
-    if (!ctx->tlsf_inited || ctx->heap == nullptr) {
-        memset(ctx->mem_pool, 0, STBTT_MEM_INCREMENT_SIZE);
-        ctx->heap = multi_heap_register(ctx->mem_pool, STBTT_MEM_INCREMENT_SIZE);
-        if (ctx->heap == nullptr) {
-            ESP_LOGE(TAG, "Heap pool add fail");
-            return nullptr;
-        } else {
-            ctx->tlsf_inited = true;
-        }
+    if (ctx->heap == nullptr) {
+        ESP_LOGE(TAG, "Scratch pool not lent");
+        return nullptr;
     }
 
     auto *ret = multi_heap_malloc(ctx->heap, len);
@@ -228,32 +231,31 @@ void *font_view::stbtt_mem_alloc(size_t len, void *_ctx)
 void font_view::stbtt_mem_free(void *ptr, void *_ctx)
 {
     auto *ctx = (font_view *)(_ctx);
+    if (ptr == nullptr || ctx->heap == nullptr) {
+        return;
+    }
+
     auto size = multi_heap_get_allocated_size(ctx->heap, ptr);
     ctx->used_mem -= size;
     ESP_LOGD(TAG, "free: -%u; %lu", size, ctx->used_mem);
     multi_heap_free(ctx->heap, ptr);
-
-    if (ctx->used_mem < 1) {
-        ctx->tlsf_inited = false;
-    }
 }
 
 font_view::~font_view()
 {
+    font_mem_governor::instance().unregister_reclaimer(layout_reclaim_handler, this);
+
     if (name != nullptr) {
         free((void *)name);
     }
 
     if (font_buf != nullptr) {
-        free((void *) font_buf);
+        font_mem_governor::instance().free(FONT_MEM_VIEW, font_buf, font_buf_len);
     }
 
-    if (heap != nullptr) {
-        heap = nullptr;
-    }
-
-    if (mem_pool != nullptr) {
-        free((void *) mem_pool);
+    free_layout_table();
+    if (layout_lock != nullptr) {
+        vSemaphoreDelete(layout_lock);
     }
 
     if (ttf_buf != nullptr) {
@@ -286,3 +288,315 @@ const char *font_view::get_name()
     return name;
 }
 
+
+esp_err_t font_view::get_text_layout(const char *txt, lv_coord_t letter_space, lv_coord_t line_space, lv_coord_t max_width, lv_text_flag_t flag, const text_layout **out)
+{
+    if (txt == nullptr || out == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if ((flag & ~(LV_TEXT_FLAG_RECOLOR | LV_TEXT_FLAG_EXPAND)) != 0) {
+        ESP_LOGE(TAG, "Unsupported text flag 0x%x", flag);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    // FNV-1a over the run, the length comes for free
+    uint32_t hash = 2166136261UL;
+    size_t txt_len = 0;
+    while (txt[txt_len] != '\0') {
+        if (txt_len >= FT_LAYOUT_MAX_TXT_LEN) {
+            ESP_LOGE(TAG, "Text run too long to lay out");
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        hash = (hash ^ (uint8_t)txt[txt_len]) * 16777619UL;
+        txt_len += 1;
+    }
+
+    xSemaphoreTakeRecursive(layout_lock, portMAX_DELAY);
+
+    // Long runs (e.g. a log view) would flush a whole cache of labels, lay them out once and don't keep them
+    free_layout(&uncached_layout);
+    if (txt_len >= FT_LAYOUT_MAX_CACHED_TXT_LEN) {
+        last_layout = nullptr;
+        auto ret = build_layout(&uncached_layout, txt, txt_len, hash, letter_space, line_space, max_width, flag);
+        if (ret == ESP_OK) {
+            last_layout = &uncached_layout;
+            *out = &uncached_layout;
+        }
+
+        xSemaphoreGiveRecursive(layout_lock);
+        return ret;
+    }
+
+    if (layout_cache == nullptr) {
+        size_t table_len = layout_cache_size * sizeof(text_layout);
+        layout_cache = (text_layout *)font_mem_governor::instance().alloc(FONT_MEM_LAYOUT, table_len);
+        if (layout_cache == nullptr) {
+            ESP_LOGE(TAG, "No mem for layout cache");
+            xSemaphoreGiveRecursive(layout_lock);
+            return ESP_ERR_NO_MEM;
+        }
+
+        memset(layout_cache, 0, table_len);
+    }
+
+    text_layout *lru_item = &layout_cache[0];
+    for (size_t idx = 0; idx < layout_cache_size; idx += 1) {
+        auto *item = &layout_cache[idx];
+        if (item->txt != nullptr && item->hash == hash && item->txt_len == txt_len && item->letter_space == letter_space
+            && item->line_space == line_space && item->max_width == max_width && item->flag == flag
+            && memcmp(item->txt, txt, txt_len) == 0) {
+            item->last_used = esp_timer_get_time();
+            last_layout = item;
+            *out = item;
+            xSemaphoreGiveRecursive(layout_lock);
+            return ESP_OK;
+        }
+
+        if (item->last_used < lru_item->last_used) {
+            lru_item = item;
+        }
+    }
+
+    // The previous result is about to become invalid anyway, so it may be reused here
+    last_layout = nullptr;
+    free_layout(lru_item);
+    auto ret = build_layout(lru_item, txt, txt_len, hash, letter_space, line_space, max_width, flag);
+    if (ret == ESP_OK) {
+        last_layout = lru_item;
+        *out = lru_item;
+    }
+
+    xSemaphoreGiveRecursive(layout_lock);
+    return ret;
+}
+
+esp_err_t font_view::get_text_size(const char *txt, lv_coord_t letter_space, lv_coord_t line_space, lv_coord_t max_width, lv_text_flag_t flag, lv_point_t *size_out)
+{
+    if (size_out == nullptr) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const text_layout *layout = nullptr;
+    auto ret = get_text_layout(txt, letter_space, line_space, max_width, flag, &layout);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    size_out->x = layout->width;
+    size_out->y = layout->height;
+    return ESP_OK;
+}
+
+esp_err_t font_view::set_layout_cache_size(size_t max_entries)
+{
+    if (max_entries < 1) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTakeRecursive(layout_lock, portMAX_DELAY);
+    free_layout_table();
+    layout_cache_size = max_entries;
+    xSemaphoreGiveRecursive(layout_lock);
+    return ESP_OK;
+}
+
+void font_view::clear_layout_cache()
+{
+    xSemaphoreTakeRecursive(layout_lock, portMAX_DELAY);
+    if (layout_cache != nullptr) {
+        for (size_t idx = 0; idx < layout_cache_size; idx += 1) {
+            free_layout(&layout_cache[idx]);
+        }
+    }
+
+    free_layout(&uncached_layout);
+    last_layout = nullptr;
+    xSemaphoreGiveRecursive(layout_lock);
+}
+
+size_t font_view::layout_reclaim_handler(size_t bytes_wanted, void *ctx)
+{
+    auto *view = (font_view *)ctx;
+
+    if (view == nullptr || xSemaphoreTakeRecursive(view->layout_lock, 0) != pdTRUE) {
+        return 0;
+    }
+
+    size_t freed = 0;
+    while (view->layout_cache != nullptr && freed < bytes_wanted) {
+        text_layout *lru_item = nullptr;
+        for (size_t idx = 0; idx < view->layout_cache_size; idx += 1) {
+            auto *item = &view->layout_cache[idx];
+            if (item->txt == nullptr || item == view->last_layout) {
+                continue;
+            }
+
+            if (lru_item == nullptr || item->last_used < lru_item->last_used) {
+                lru_item = item;
+            }
+        }
+
+        if (lru_item == nullptr) {
+            break;
+        }
+
+        freed += lru_item->alloc_len;
+        view->free_layout(lru_item);
+    }
+
+    xSemaphoreGiveRecursive(view->layout_lock);
+    ESP_LOGD(TAG, "Reclaimed %zu layout bytes", freed);
+    return freed;
+}
+
+esp_err_t font_view::build_layout(text_layout *item, const char *txt, size_t txt_len, uint32_t hash, lv_coord_t letter_space, lv_coord_t line_space, lv_coord_t max_width, lv_text_flag_t flag)
+{
+    uint32_t byte_idx = 0;
+    size_t cp_cnt = 0;
+    while (byte_idx < txt_len) {
+        _lv_txt_encoded_next(txt, &byte_idx);
+        cp_cnt += 1;
+    }
+
+    // Glyphs, line starts and a copy of the text in one block; every code point could start a line at worst
+    size_t glyphs_len = cp_cnt * sizeof(text_layout_glyph);
+    size_t lines_len = (cp_cnt + 1) * sizeof(uint16_t);
+    size_t alloc_len = glyphs_len + lines_len + txt_len;
+    auto *block = (uint8_t *)font_mem_governor::instance().alloc(FONT_MEM_LAYOUT, alloc_len);
+    if (block == nullptr) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    item->glyphs = (text_layout_glyph *)block;
+    item->line_starts = (uint16_t *)(block + glyphs_len);
+    item->txt = (char *)(block + glyphs_len + lines_len);
+    memcpy(item->txt, txt, txt_len);
+    item->alloc_len = alloc_len;
+    item->hash = hash;
+    item->txt_len = txt_len;
+    item->letter_space = letter_space;
+    item->line_space = line_space;
+    item->max_width = max_width;
+    item->flag = flag;
+
+    // Like lv_txt_get_size(): EXPAND never wraps, RECOLOR hides the "#rrggbb ...#" commands
+    if ((flag & LV_TEXT_FLAG_EXPAND) != 0) {
+        max_width = 0;
+    }
+
+    lv_text_cmd_state_t cmd_state = LV_TEXT_CMD_STATE_WAIT;
+    lv_coord_t line_pitch = (lv_coord_t)(lv_font.line_height + line_space);
+    lv_coord_t x = 0;
+    lv_coord_t y = 0;
+    uint16_t glyph_cnt = 0;
+    uint16_t line_cnt = 1;
+    uint16_t break_idx = 0;     // First glyph after the last break char on this line, 0 if none
+    item->line_starts[0] = 0;
+
+    byte_idx = 0;
+    while (byte_idx < txt_len) {
+        uint32_t letter_byte_ofs = byte_idx;
+        uint32_t letter = _lv_txt_encoded_next(txt, &byte_idx);
+        uint32_t next_byte_idx = byte_idx;
+        uint32_t letter_next = byte_idx < txt_len ? _lv_txt_encoded_next(txt, &next_byte_idx) : 0;
+
+        if (letter == '\n' || letter == '\r') {
+            if (letter == '\r' && letter_next == '\n') {
+                byte_idx = next_byte_idx;
+            }
+
+            x = 0;
+            y = (lv_coord_t)(y + line_pitch);
+            item->line_starts[line_cnt] = glyph_cnt;
+            line_cnt += 1;
+            break_idx = 0;
+            continue;
+        }
+
+        if ((flag & LV_TEXT_FLAG_RECOLOR) != 0 && _lv_txt_is_cmd(&cmd_state, letter)) {
+            continue;
+        }
+
+        lv_font_glyph_dsc_t dsc = {};
+        uint16_t adv_w = get_glyph_dsc_handler(&lv_font, &dsc, letter, letter_next) ? dsc.adv_w : 0;
+
+        // Wrap like LVGL does: at the last break char if this line has one, otherwise right before this glyph
+        uint16_t line_start = item->line_starts[line_cnt - 1];
+        if (max_width > 0 && glyph_cnt > line_start && x + adv_w > max_width) {
+            uint16_t wrap_idx = break_idx > line_start ? break_idx : glyph_cnt;
+            lv_coord_t shift_x = wrap_idx < glyph_cnt ? item->glyphs[wrap_idx].x : x;
+            y = (lv_coord_t)(y + line_pitch);
+            for (uint16_t idx = wrap_idx; idx < glyph_cnt; idx += 1) {
+                item->glyphs[idx].x = (lv_coord_t)(item->glyphs[idx].x - shift_x);
+                item->glyphs[idx].y = y;
+            }
+
+            x = (lv_coord_t)(x - shift_x);
+            item->line_starts[line_cnt] = wrap_idx;
+            line_cnt += 1;
+            break_idx = 0;
+
+            // The word carried over may still be too long with this glyph, then break right before it too
+            if (glyph_cnt > wrap_idx && x + adv_w > max_width) {
+                y = (lv_coord_t)(y + line_pitch);
+                x = 0;
+                item->line_starts[line_cnt] = glyph_cnt;
+                line_cnt += 1;
+            }
+        }
+
+        auto *glyph = &item->glyphs[glyph_cnt];
+        glyph->codepoint = letter;
+        glyph->byte_ofs = (uint16_t)letter_byte_ofs;
+        glyph->adv_w = adv_w;
+        glyph->x = x;
+        glyph->y = y;
+        glyph_cnt += 1;
+
+        x = (lv_coord_t)(x + adv_w + letter_space);
+        if (letter < 0x80 && strchr(LV_TXT_BREAK_CHARS, (int)letter) != nullptr) {
+            break_idx = glyph_cnt;
+        }
+    }
+
+    // Widest line, without the trailing letter space
+    lv_coord_t width = 0;
+    for (uint16_t line = 0; line < line_cnt; line += 1) {
+        uint16_t end_idx = line + 1 < line_cnt ? item->line_starts[line + 1] : glyph_cnt;
+        if (end_idx > item->line_starts[line]) {
+            auto *last = &item->glyphs[end_idx - 1];
+            width = LV_MAX(width, (lv_coord_t)(last->x + last->adv_w));
+        }
+    }
+
+    item->glyph_cnt = glyph_cnt;
+    item->line_cnt = line_cnt;
+    item->width = width;
+    item->height = (lv_coord_t)(line_cnt * lv_font.line_height + (line_cnt - 1) * line_space);
+    item->last_used = esp_timer_get_time();
+
+    return ESP_OK;
+}
+
+void font_view::free_layout_table()
+{
+    xSemaphoreTakeRecursive(layout_lock, portMAX_DELAY);
+    clear_layout_cache();
+    if (layout_cache != nullptr) {
+        font_mem_governor::instance().free(FONT_MEM_LAYOUT, layout_cache, layout_cache_size * sizeof(text_layout));
+        layout_cache = nullptr;
+    }
+
+    xSemaphoreGiveRecursive(layout_lock);
+}
+
+void font_view::free_layout(text_layout *item)
+{
+    if (item->glyphs != nullptr) {
+        font_mem_governor::instance().free(FONT_MEM_LAYOUT, item->glyphs, item->alloc_len);
+    }
+
+    *item = {};
+}
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
 
 struct glyph_item
 {
@@ -9,6 +11,7 @@ struct glyph_item
     uint8_t *bitmap;
     size_t len;
     uint64_t last_used;
+    uint32_t access_cnt;
 };
 
 class font_cacher
@@ -24,21 +27,37 @@ public:
     font_cacher(font_cacher const&) = delete;
 
 private:
-    font_cacher() = default;
+    font_cacher();
     uint32_t instance_ctr = 0;
     size_t cache_size = 0;
     size_t cache_used = 0;
     size_t glyph_slot_size = 0;
     size_t glyph_slot_cnt = 0;
     glyph_item *cached_glyphs = nullptr;
+    volatile uint32_t generation = 0;
+    SemaphoreHandle_t cache_lock = nullptr;
     static constexpr const char *TAG = "ft_cacher";
 
 public:
     esp_err_t init(size_t buf_size, size_t glyph_cnt);
+    bool is_inited();
     uint32_t get_new_renderer_id();
     bool has_cache(uint32_t renderer_id, uint32_t codepoint);
     esp_err_t get_cache(uint32_t renderer_id, uint32_t codepoint, glyph_item *out);
-    esp_err_t add_cache(uint32_t renderer_id, uint32_t codepoint, uint8_t *buf_in, size_t buf_sz);
+    esp_err_t copy_cache(uint32_t renderer_id, uint32_t codepoint, uint8_t *buf_out, size_t len, size_t *len_out, bool touch = true);
+    esp_err_t add_cache(uint32_t renderer_id, uint32_t codepoint, uint8_t *buf_in, size_t buf_sz, uint32_t access_cnt = 1);
+    esp_err_t preload_cache(uint32_t renderer_id, uint32_t codepoint, uint8_t *buf_in, size_t buf_sz, uint32_t access_cnt, uint64_t last_used);
     esp_err_t make_room(size_t *free_idx, size_t space_needed);
+    size_t get_hot_set(glyph_item *out, size_t max_cnt); // Metadata only, `bitmap` is left null
+    void age_access_cnt();
+    uint32_t get_generation();
+
+    // Bitmaps handed to add_cache()/preload_cache() must come from here, the cache frees them on eviction
+    static uint8_t *alloc_bitmap(size_t len, bool allow_reclaim = true);
+    static void free_bitmap(uint8_t *bitmap, size_t len);
+
+private:
+    static size_t reclaim_handler(size_t bytes_wanted, void *ctx);
+    size_t evict_oldest();
 };
 
@@ -2,9 +2,56 @@
 
 #include <cstdio>
 #include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+#define FT_DISK_CACHE_MAX_RENDERERS 16
+#define FT_HOT_SET_DEFAULT_ENTRIES 256
+#define FT_HOT_SET_MAGIC 0x54455348 // "HSET"
+#define FT_HOT_SET_VERSION 1
 
 typedef size_t (*get_part_free_space_fn)(void *);
 
+// Hot-set manifest layout: header, then per renderer one section header + font name,
+// followed by its entries, each entry followed by its bitmap payload
+struct __attribute__((packed)) hot_set_header
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t section_cnt;
+};
+
+struct __attribute__((packed)) hot_set_section
+{
+    uint8_t font_size;
+    uint8_t name_len;
+    uint16_t entry_cnt;
+    uint32_t payload_len;
+};
+
+struct __attribute__((packed)) hot_set_entry
+{
+    uint32_t codepoint;
+    uint32_t access_cnt;
+    uint16_t len;
+};
+
+struct disk_renderer_item
+{
+    char *font_name;
+    uint8_t font_size;
+    uint32_t renderer_id;
+};
+
+struct hot_set_section_item
+{
+    char *font_name;
+    uint8_t font_size;
+    uint16_t entry_cnt;
+    long offset;
+};
+
 class font_disk_cacher
 {
 public:
@@ -23,13 +70,31 @@ public:
     esp_err_t add_bitmap(const char *font_name, uint8_t font_size, uint32_t codepoint, uint8_t *buf, size_t len);
     esp_err_t get_bitmap(const char *font_name, uint8_t font_size, uint32_t codepoint, uint8_t *buf_out, size_t len, size_t *len_out);
     esp_err_t delete_all();
+    esp_err_t set_hot_set_autosave(size_t max_entries, uint32_t interval_ms);
+    esp_err_t save_hot_set(TickType_t wait_ticks = portMAX_DELAY);
 
 private:
-    font_disk_cacher() = default;
+    font_disk_cacher();
+    static void shutdown_handler();
+    static void hot_set_task(void *ctx);
+    esp_err_t save_hot_set_locked();
+    disk_renderer_item *find_renderer(const char *font_name, uint8_t font_size);
+    void add_to_ram_tier(const char *font_name, uint8_t font_size, uint32_t codepoint, const uint8_t *buf, size_t len);
+    esp_err_t load_hot_set_index();
+    esp_err_t load_hot_set(const disk_renderer_item *renderer);
 
 private:
     get_part_free_space_fn free_space_getter_fn = nullptr;
     void *get_free_space_fn_ctx = nullptr;
     char *base_path = nullptr;
+    disk_renderer_item renderers[FT_DISK_CACHE_MAX_RENDERERS] = {};
+    size_t renderer_cnt = 0;
+    hot_set_section_item hot_set_sections[FT_DISK_CACHE_MAX_RENDERERS] = {};
+    size_t hot_set_section_cnt = 0;
+    size_t hot_set_max_entries = FT_HOT_SET_DEFAULT_ENTRIES;
+    uint32_t hot_set_saved_gen = 0; // RAM tier generation at the last save
+    volatile uint32_t hot_set_interval_ms = 0;
+    TaskHandle_t hot_set_task_handle = nullptr;
+    SemaphoreHandle_t hot_set_lock = nullptr; // Serialises manifest file I/O and the section index
     static const constexpr char *TAG = "ft_disk_cache";
 };
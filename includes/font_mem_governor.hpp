@@ -0,0 +1,76 @@
+#pragma once
+
+#include <esp_err.h>
+#include <multi_heap.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#define FT_MEM_SCRATCH_DEFAULT_SIZE (98304)
+#define FT_MEM_MAX_RECLAIMERS 16 // One per font_view layout cache plus the glyph cache
+
+enum font_mem_component : uint8_t
+{
+    FONT_MEM_VIEW = 0,      // Per-view glyph output buffers
+    FONT_MEM_SCRATCH = 1,   // Shared stb_truetype rasteriser scratch pool
+    FONT_MEM_CACHE = 2,     // Glyph caches in RAM
+    FONT_MEM_LAYOUT = 3,    // Cached text run layouts
+    FONT_MEM_COMPONENT_MAX,
+};
+
+// Asked to give back at least `bytes_wanted` bytes, returns how many bytes were actually released
+typedef size_t (*font_mem_reclaim_fn)(size_t bytes_wanted, void *ctx);
+
+struct font_mem_reclaimer
+{
+    font_mem_reclaim_fn fn;
+    void *ctx;
+};
+
+class font_mem_governor
+{
+public:
+    static font_mem_governor& instance()
+    {
+        static font_mem_governor governor;
+        return governor;
+    }
+
+    void operator=(font_mem_governor const&) = delete;
+    font_mem_governor(font_mem_governor const&) = delete;
+
+public:
+    esp_err_t init(size_t _budget, size_t _scratch_size = FT_MEM_SCRATCH_DEFAULT_SIZE);
+    esp_err_t reserve(font_mem_component comp, size_t len, bool allow_reclaim = true);
+    void release(font_mem_component comp, size_t len);
+    void *alloc(font_mem_component comp, size_t len, bool allow_reclaim = true);
+    void free(font_mem_component comp, void *ptr, size_t len);
+
+    // Reclaimers run on whichever task hit the budget, possibly while that task holds the cache being asked.
+    // So they only try-lock their cache, never block on one another task is using, and the lock is recursive
+    // so a cache allocating under its own lock can still be reclaimed from.
+    esp_err_t register_reclaimer(font_mem_reclaim_fn fn, void *ctx);
+    esp_err_t unregister_reclaimer(font_mem_reclaim_fn fn, void *ctx); // Waits for a reclaim in flight, ctx can be freed afterwards
+    multi_heap_handle_t acquire_scratch(TickType_t wait_ticks = portMAX_DELAY);
+    void release_scratch();
+    size_t get_usage(font_mem_component comp);
+    size_t get_total_usage();
+    size_t get_budget();
+
+private:
+    font_mem_governor();
+    size_t reclaim(size_t bytes_wanted);
+    size_t trim_scratch();
+
+private:
+    size_t budget = SIZE_MAX;
+    size_t total_used = 0;
+    size_t comp_used[FONT_MEM_COMPONENT_MAX] = {};
+    size_t scratch_size = FT_MEM_SCRATCH_DEFAULT_SIZE;
+    uint8_t *scratch_pool = nullptr;
+    multi_heap_handle_t scratch_heap = nullptr;
+    SemaphoreHandle_t scratch_lock = nullptr;
+    SemaphoreHandle_t state_lock = nullptr;
+    SemaphoreHandle_t reclaim_lock = nullptr;
+    font_mem_reclaimer reclaimers[FT_MEM_MAX_RECLAIMERS] = {};
+    static constexpr const char *TAG = "ft_mem_gov";
+};
@@ -9,6 +9,39 @@
 #include <stb_truetype.h>
 
 #include "font_disk_cacher.hpp"
+#include "font_mem_governor.hpp"
+
+#define FT_LAYOUT_CACHE_DEFAULT_ENTRIES 16
+#define FT_LAYOUT_MAX_CACHED_TXT_LEN 512 // Longer runs get a one-off layout that isn't kept in the cache
+#define FT_LAYOUT_MAX_TXT_LEN UINT16_MAX // Glyph byte offsets and counts are 16-bit
+
+struct text_layout_glyph
+{
+    uint32_t codepoint;
+    uint16_t byte_ofs;
+    uint16_t adv_w;
+    lv_coord_t x;
+    lv_coord_t y;
+};
+
+struct text_layout
+{
+    uint32_t hash;
+    char *txt;
+    size_t txt_len;
+    lv_coord_t letter_space;
+    lv_coord_t line_space;
+    lv_coord_t max_width;
+    lv_text_flag_t flag;
+    lv_coord_t width;
+    lv_coord_t height;
+    uint16_t glyph_cnt;
+    uint16_t line_cnt;
+    text_layout_glyph *glyphs;
+    uint16_t *line_starts;      // Index of the first glyph on each line
+    size_t alloc_len;
+    uint64_t last_used;
+};
 
 class font_view
 {
@@ -17,6 +50,7 @@ public:
     static const uint8_t *get_glyph_bitmap_handler(const lv_font_t *font, uint32_t unicode_letter);
     static void *stbtt_mem_alloc(size_t len, void *_ctx);
     static void stbtt_mem_free(void *ptr, void *_ctx);
+    static size_t layout_reclaim_handler(size_t bytes_wanted, void *ctx);
 
 public:
     explicit font_view(const char *_name, bool _disable_cache = true);
@@ -28,22 +62,41 @@ public:
     esp_err_t init(const char *file_path, uint8_t _height_px);
     esp_err_t init(const uint8_t *buf, size_t len, uint8_t _height_px);
 
+    // Returned layout stays valid until the next layout call on this view, reclaims never drop it.
+    // Supports LV_TEXT_FLAG_RECOLOR and LV_TEXT_FLAG_EXPAND, other flags give ESP_ERR_NOT_SUPPORTED.
+    // Runs of FT_LAYOUT_MAX_TXT_LEN bytes or more give ESP_ERR_INVALID_SIZE.
+    esp_err_t get_text_layout(const char *txt, lv_coord_t letter_space, lv_coord_t line_space, lv_coord_t max_width, lv_text_flag_t flag, const text_layout **out);
+    esp_err_t get_text_size(const char *txt, lv_coord_t letter_space, lv_coord_t line_space, lv_coord_t max_width, lv_text_flag_t flag, lv_point_t *size_out);
+    esp_err_t set_layout_cache_size(size_t max_entries);
+    void clear_layout_cache();
+
+private:
+    bool render_glyph(uint32_t unicode_letter);
+    esp_err_t build_layout(text_layout *item, const char *txt, size_t txt_len, uint32_t hash, lv_coord_t letter_space, lv_coord_t line_space, lv_coord_t max_width, lv_text_flag_t flag);
+    void free_layout(text_layout *item);
+    void free_layout_table();
+
 private:
     uint8_t height_px = 0;
-    volatile bool tlsf_inited = false;
     bool disable_cache = false;
 
     uint8_t *ttf_buf = nullptr;
     size_t ttf_len = 0;
     uint8_t *font_buf = nullptr;
-    uint8_t *mem_pool = nullptr;
+    size_t font_buf_len = 0;
     const char *name = nullptr;
     uint32_t used_mem = 0;
 
     float scale = 0;
 
+    text_layout *layout_cache = nullptr;
+    size_t layout_cache_size = FT_LAYOUT_CACHE_DEFAULT_ENTRIES;
+    text_layout uncached_layout = {}; // Runs too long for the cache, freed by the next layout call
+    const text_layout *last_layout = nullptr;
+    SemaphoreHandle_t layout_lock = nullptr;
+
     lv_font_t lv_font = {};
     stbtt_fontinfo stb_font = {};
     static const constexpr char *TAG = "font_view";
-    multi_heap_handle_t heap = nullptr;
+    multi_heap_handle_t heap = nullptr; // Only valid while the shared scratch pool is lent to this view
 };